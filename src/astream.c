@@ -12,50 +12,75 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/file.h>
 #include <regex.h>
 #include <getopt.h>
 #include "astream.h"
 #include "astream_log.h"
+#include "astream_tuner.h"
 
 static int nr_watches = 0;
 static watch_target_t targets[BUFF_SIZE];
 static FILE *fp = NULL;
-static int inotify_fd = -1;
-
-static void free_res(int fd)
+static target_group_t groups[MAX_GROUP_NUM];
+static int nr_groups = 0;
+static int signal_fd = -1;
+static int fail_fd = -1; /* eventfd for the workers to report a failure */
+static int epoll_fd = -1;
+static loop_timer_t timers[MAX_TIMER_NUM];
+static int nr_timers = 0;
+static char *tune_source = NULL;
+static int tune_epoch = TUNE_DEFAULT_EPOCH;
+static int queue_limit = 0;
+static int worker_affinity = 0;
+
+static void free_res(target_group_t *group)
 {
     /* removing the monitored directories from the monitoring list. */
-    for (int wd = 1; wd <= nr_watches; ++wd) {
-        inotify_rm_watch(fd, wd);
+    for (int wd = 1; wd < MAX_GROUP_WATCHES; ++wd) {
+        if (group->wd_target[wd])
+            inotify_rm_watch(group->inotify_fd, wd);
     }
 
     /* close the INOTIFY instance. */
-    close(fd);
+    close(group->inotify_fd);
+    group->inotify_fd = -1;
 }
 
-static void add_watch(int fd, int index)
+static int add_watch(target_group_t *group, int index)
 {
     char *dir = targets[index].watch_dir;
-    int wd = inotify_add_watch(fd, dir, IN_CREATE);
+    int wd = inotify_add_watch(group->inotify_fd, dir, IN_CREATE);
 
-    if (wd == -1) {
-        free_res(fd);
-        astream_log(ASTREAM_LOG_ERROR, "inotify_add_watch() failed");
-        exit(EXIT_FAILURE);
+    if (wd == -1 || wd >= MAX_GROUP_WATCHES) {
+        astream_log(ASTREAM_LOG_ERROR, "inotify_add_watch() failed for %s\n", dir);
+        return -1;
     }
 
+    group->wd_target[wd] = index;
     astream_log(ASTREAM_LOG_INFO, "begin to watching %s\n", dir);
+
+    return 0;
 }
 
 /*
  * use fcntl to set the stream of the target file truely.
  */
-static void do_set_stream(int stream, const char *target_file)
+void do_set_stream(int stream, const char *target_file)
 {
     /* set the stream. */
     int fd = open(target_file, O_RDONLY);
@@ -72,14 +97,13 @@ static void do_set_stream(int stream, const char *target_file)
     close(fd);
 }
 
-static void pass_stream_for_file(struct inotify_event *event)
+static void pass_stream_for_file(target_group_t *group, int wd, const char *name)
 {
-    if (!(event->mask & IN_CREATE))
+    if (wd <= 0 || wd >= MAX_GROUP_WATCHES)
         return;
 
-    /* we only focus on the IN_CREATE event. */
+    watch_target_t *target = &targets[group->wd_target[wd]];
     int ret;
-    int stream;
     int cflags;
     int len;
     char path[BUFF_SIZE];
@@ -87,23 +111,22 @@ static void pass_stream_for_file(struct inotify_event *event)
     regmatch_t pmatch;
     regex_t reg;
 
-    dir = targets[event->wd].watch_dir;
-    len = strlen(dir) + strlen(event->name) + 2;
+    dir = target->watch_dir;
+    len = strlen(dir) + strlen(name) + 2;
     if (len > BUFF_SIZE)
         return ;
-    snprintf(path, len, "%s/%s", dir, event->name);
+    snprintf(path, len, "%s/%s", dir, name);
 
     astream_log(ASTREAM_LOG_INFO, "file %s has created\n", path);
 
     cflags = REG_EXTENDED | REG_NEWLINE;
 
     /* match each rule one-by-one with new created file. */
-    for (int i = 0; i < targets[event->wd].rule_num; ++i) {
-        stream = targets[event->wd].stream_rule[i].stream;
-        ret = regcomp(&reg, targets[event->wd].stream_rule[i].rule, cflags);
+    for (int i = 0; i < target->rule_num; ++i) {
+        ret = regcomp(&reg, target->stream_rule[i].rule, cflags);
         if (ret) {
             astream_log(ASTREAM_LOG_ERROR, "failed to compile the regex "
-                "expression %s\n", targets[event->wd].stream_rule[i].rule);
+                "expression %s\n", target->stream_rule[i].rule);
             regfree(&reg);
             continue;
         }
@@ -111,7 +134,7 @@ static void pass_stream_for_file(struct inotify_event *event)
         ret = regexec(&reg, path, 1, &pmatch, 0);
         if (ret != REG_NOMATCH && pmatch.rm_so != -1) {
             astream_log(ASTREAM_LOG_INFO, "start to set stream for %s\n", path);
-            do_set_stream(stream, path);
+            tuner_hint_file(&target->stream_rule[i], path);
             regfree(&reg);
             return;
         }
@@ -122,21 +145,408 @@ static void pass_stream_for_file(struct inotify_event *event)
     astream_log(ASTREAM_LOG_INFO, "no stream rule is matched with %s\n", path);
 }
 
-/* monitor the creation movement of target file under monitored directory. */
-static void inotify_accept(int fd)
+/*
+ * monitor the creation movement of target file under monitored directory,
+ * the queued events are handled in batches until the inotify fd runs dry,
+ * or until about budget events are handled if budget is not 0. the events
+ * over the budget stay in the kernel queue for the next epoll wakeup.
+ */
+static int inotify_accept(target_group_t *group, int budget)
 {
-    char buf[EVENT_BUF_LEN];
+    char buf[EVENT_BUF_LEN] __attribute__((aligned(__alignof__(struct inotify_event))));
     ssize_t nr_read;
+    size_t len = EVENT_BUF_LEN;
     struct inotify_event *event;
+    int nr_handled = 0;
+
+    while (!budget || nr_handled < budget) {
+        /* an event takes EVENT_SIZE at least, so a smaller read keeps the budget. */
+        if (budget) {
+            len = (size_t)(budget - nr_handled) * EVENT_SIZE;
+            if (len < EVENT_MAX_SIZE)
+                len = EVENT_MAX_SIZE;
+            if (len > EVENT_BUF_LEN)
+                len = EVENT_BUF_LEN;
+        }
+
+        nr_read = read(group->inotify_fd, buf, len);
+        if (nr_read < 0 && errno == EINTR)
+            continue;
+
+        if (nr_read < 0 && errno == EAGAIN)
+            return 0;
+
+        if (nr_read <= 0) {
+            astream_log(ASTREAM_LOG_ERROR, "failed to read inotify events\n");
+            return -1;
+        }
 
-    while ((nr_read = read(fd, buf, EVENT_BUF_LEN)) > 0) {
         /* process all of the events in buffer returned by read(). */
         for (char *p = buf; p < buf + nr_read;) {
             event = (struct inotify_event *)p;
-            pass_stream_for_file(event);
+            if (event->mask & IN_Q_OVERFLOW)
+                astream_log(ASTREAM_LOG_WARN, "inotify event queue of device "
+                            "%u:%u overflowed, some files may miss their streams\n",
+                            major(group->dev), minor(group->dev));
+            else if (event->mask & IN_CREATE) /* we only focus on the IN_CREATE event. */
+                pass_stream_for_file(group, event->wd, event->name);
             p += EVENT_SIZE + event->len;
+            ++nr_handled;
+        }
+    }
+
+    return 0;
+}
+
+static int add_to_epoll(int epfd, int fd)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* register a periodic job which is run by the main loop every interval seconds. */
+static int add_timer(const char *name, int interval, void (*fn)(void))
+{
+    struct itimerspec its;
+    loop_timer_t *timer;
+
+    if (nr_timers >= MAX_TIMER_NUM) {
+        astream_log(ASTREAM_LOG_ERROR, "too many timers, failed to add %s\n", name);
+        return -1;
+    }
+
+    timer = &timers[nr_timers];
+    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer->fd < 0) {
+        astream_log(ASTREAM_LOG_ERROR, "timerfd_create() failed for %s\n", name);
+        return -1;
+    }
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = interval;
+    its.it_interval.tv_sec = interval;
+    if (timerfd_settime(timer->fd, 0, &its, NULL) < 0 || add_to_epoll(epoll_fd, timer->fd) < 0) {
+        astream_log(ASTREAM_LOG_ERROR, "failed to arm the timer %s\n", name);
+        close(timer->fd);
+        return -1;
+    }
+
+    timer->name = name;
+    timer->interval = interval;
+    timer->fn = fn;
+    ++nr_timers;
+    astream_log(ASTREAM_LOG_INFO, "run %s every %d seconds\n", name, interval);
+
+    return 0;
+}
+
+static void run_timer(int fd)
+{
+    uint64_t expirations;
+
+    for (int i = 0; i < nr_timers; ++i) {
+        if (timers[i].fd != fd)
+            continue;
+
+        if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            return;
+
+        /* keep the fixed cadence, the missed ticks are not made up. */
+        if (expirations > 1)
+            astream_log(ASTREAM_LOG_WARN, "%s missed %llu ticks\n", timers[i].name,
+                        (unsigned long long)expirations - 1);
+
+        timers[i].fn();
+        return;
+    }
+}
+
+/* return 1 if a signal asking the daemon to stop has been received. */
+static int accept_signal(int fd)
+{
+    struct signalfd_siginfo info;
+    int stop = 0;
+
+    while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+        astream_log(ASTREAM_LOG_INFO, "received signal %d, stop the astream "
+                    "daemon\n", (int)info.ssi_signo);
+        stop = 1;
+    }
+
+    return stop;
+}
+
+/* return 0 if the loop is stopped by a signal, -1 on a fatal error. */
+static int event_loop(void)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int running = 1;
+    int nr_events;
+    int fd;
+
+    while (running) {
+        nr_events = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        if (nr_events < 0) {
+            if (errno == EINTR)
+                continue;
+            astream_log(ASTREAM_LOG_ERROR, "epoll_wait() failed\n");
+            return -1;
+        }
+
+        for (int i = 0; i < nr_events; ++i) {
+            fd = events[i].data.fd;
+            if (fd == signal_fd) {
+                if (accept_signal(fd))
+                    running = 0;
+            } else if (fd == fail_fd) {
+                astream_log(ASTREAM_LOG_ERROR, "a device worker has failed, stop "
+                            "the astream daemon\n");
+                return -1;
+            } else {
+                run_timer(fd);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * the worker of a target group, it only handles the events of its own
+ * device, so a storm on one device cannot delay the hints on the others.
+ */
+static void *group_worker(void *arg)
+{
+    target_group_t *group = arg;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    uint64_t one = 1;
+    int running = 1;
+    int failed = 0;
+    int nr_events;
+
+    if (group->nr_cpus > 0 &&
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &group->cpus) != 0)
+        astream_log(ASTREAM_LOG_WARN, "failed to pin the worker of device %u:%u "
+                    "to numa node %d\n", major(group->dev), minor(group->dev),
+                    group->numa_node);
+
+    while (running) {
+        nr_events = epoll_wait(group->epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        if (nr_events < 0) {
+            if (errno == EINTR)
+                continue;
+            astream_log(ASTREAM_LOG_ERROR, "epoll_wait() failed\n");
+            failed = 1;
+            break;
+        }
+
+        for (int i = 0; i < nr_events; ++i) {
+            if (events[i].data.fd == group->stop_fd) {
+                running = 0;
+            } else if (inotify_accept(group, queue_limit) < 0) {
+                failed = 1;
+                running = 0;
+            }
+        }
+    }
+
+    /* a dead group must not hide behind a healthy looking daemon. */
+    if (failed) {
+        astream_log(ASTREAM_LOG_ERROR, "the worker of device %u:%u has failed\n",
+                    major(group->dev), minor(group->dev));
+        if (write(fail_fd, &one, sizeof(one)) != sizeof(one))
+            astream_log(ASTREAM_LOG_ERROR, "failed to report the failure of device "
+                        "%u:%u\n", major(group->dev), minor(group->dev));
+        return NULL;
+    }
+
+    /* never drop the events queued before the stop request. */
+    inotify_accept(group, 0);
+
+    return NULL;
+}
+
+/* find the numa node of the device backing dev, -1 if it is unknown. */
+static int get_dev_numa_node(dev_t dev)
+{
+    char path[PATH_MAX + 16];
+    char real[PATH_MAX];
+    char *slash;
+    int node = -1;
+    FILE *nfp;
+
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u", major(dev), minor(dev));
+    if (!realpath(path, real))
+        return -1;
+
+    /* walk up from the block device to the first parent reporting its node. */
+    while (strncmp(real, "/sys/devices/", strlen("/sys/devices/")) == 0) {
+        snprintf(path, sizeof(path), "%s/numa_node", real);
+        nfp = fopen(path, "r");
+        if (nfp) {
+            if (fscanf(nfp, "%d", &node) != 1)
+                node = -1;
+            fclose(nfp);
+            return node;
+        }
+
+        slash = strrchr(real, '/');
+        if (!slash)
+            break;
+        *slash = '\0';
+    }
+
+    return -1;
+}
+
+/* parse the cpulist of a numa node, such as "0-15,32-47". */
+static int get_node_cpus(int node, cpu_set_t *cpus)
+{
+    char path[BUFF_SIZE];
+    char list[BUFF_SIZE];
+    char *range, *save = NULL;
+    int first, last;
+    FILE *nfp;
+
+    snprintf(path, BUFF_SIZE, "/sys/devices/system/node/node%d/cpulist", node);
+    nfp = fopen(path, "r");
+    if (!nfp)
+        return -1;
+
+    if (!fgets(list, BUFF_SIZE, nfp)) {
+        fclose(nfp);
+        return -1;
+    }
+    fclose(nfp);
+
+    CPU_ZERO(cpus);
+    for (range = strtok_r(list, ",\n", &save); range; range = strtok_r(NULL, ",\n", &save)) {
+        if (sscanf(range, "%d-%d", &first, &last) != 2) {
+            if (sscanf(range, "%d", &first) != 1)
+                continue;
+            last = first;
+        }
+
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, cpus);
+    }
+
+    return CPU_COUNT(cpus);
+}
+
+static target_group_t *get_group(dev_t dev)
+{
+    target_group_t *group;
+
+    for (int i = 0; i < nr_groups; ++i) {
+        if (groups[i].dev == dev)
+            return &groups[i];
+    }
+
+    if (nr_groups >= MAX_GROUP_NUM) {
+        astream_log(ASTREAM_LOG_ERROR, "the number of devices is bigger than %d\n",
+                    MAX_GROUP_NUM);
+        return NULL;
+    }
+
+    group = &groups[nr_groups++];
+    memset(group, 0, sizeof(*group));
+    group->dev = dev;
+    group->stop_fd = -1;
+    group->epoll_fd = -1;
+    group->numa_node = -1;
+    group->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (group->inotify_fd < 0) {
+        astream_log(ASTREAM_LOG_ERROR, "inotify_init() failed\n");
+        return NULL;
+    }
+
+
+    group->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    group->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (group->stop_fd < 0 || group->epoll_fd < 0 ||
+        add_to_epoll(group->epoll_fd, group->inotify_fd) < 0 ||
+        add_to_epoll(group->epoll_fd, group->stop_fd) < 0) {
+        astream_log(ASTREAM_LOG_ERROR, "failed to init the event source of "
+                    "device %u:%u\n", major(dev), minor(dev));
+        return NULL;
+    }
+
+    if (worker_affinity) {
+        group->numa_node = get_dev_numa_node(dev);
+        if (group->numa_node >= 0)
+            group->nr_cpus = get_node_cpus(group->numa_node, &group->cpus);
+    }
+
+    return group;
+}
+
+/* group the targets by their backing device, one inotify instance for each. */
+static int init_groups(void)
+{
+    target_group_t *group;
+    struct stat st;
+
+    for (int i = 1; i <= nr_watches; ++i) {
+        if (stat(targets[i].watch_dir, &st) < 0) {
+            astream_log(ASTREAM_LOG_ERROR, "failed to stat %s\n", targets[i].watch_dir);
+            return -1;
         }
+
+        group = get_group(st.st_dev);
+        if (!group || add_watch(group, i) < 0)
+            return -1;
+        ++group->nr_targets;
     }
+
+    for (int i = 0; i < nr_groups; ++i) {
+        group = &groups[i];
+        if (pthread_create(&group->worker, NULL, group_worker, group) != 0) {
+            astream_log(ASTREAM_LOG_ERROR, "failed to start the worker of device "
+                        "%u:%u\n", major(group->dev), minor(group->dev));
+            return -1;
+        }
+
+        group->started = 1;
+        astream_log(ASTREAM_LOG_INFO, "device %u:%u has %d targets, numa node %d\n",
+                    major(group->dev), minor(group->dev), group->nr_targets,
+                    group->numa_node);
+    }
+
+    return 0;
+}
+
+static void stop_groups(void)
+{
+    uint64_t one = 1;
+    target_group_t *group;
+
+    for (int i = 0; i < nr_groups; ++i) {
+        group = &groups[i];
+        if (group->started && write(group->stop_fd, &one, sizeof(one)) != sizeof(one))
+            astream_log(ASTREAM_LOG_ERROR, "failed to stop the worker of device "
+                        "%u:%u\n", major(group->dev), minor(group->dev));
+    }
+
+    for (int i = 0; i < nr_groups; ++i) {
+        group = &groups[i];
+        if (group->started)
+            pthread_join(group->worker, NULL);
+
+        if (group->stop_fd >= 0)
+            close(group->stop_fd);
+        if (group->epoll_fd >= 0)
+            close(group->epoll_fd);
+        if (group->inotify_fd >= 0)
+            free_res(group);
+    }
+
+    nr_groups = 0;
 }
 
 static char *trimwhitespace(char *s)
@@ -231,6 +641,28 @@ err:
     return -1;
 }
 
+/* resolve a path into a buffer of BUFF_SIZE, the longer one is rejected. */
+static int resolve_path(const char *path, char *resolved)
+{
+    char *real = realpath(path, NULL);
+
+    if (!real) {
+        printf("error: failed to resolve the path %s\n", path);
+        return -1;
+    }
+
+    if (strlen(real) >= BUFF_SIZE) {
+        printf("error: the path %s is longer than %d\n", real, BUFF_SIZE - 1);
+        free(real);
+        return -1;
+    }
+
+    strcpy(resolved, real);
+    free(real);
+
+    return 0;
+}
+
 static int check_path_argument(const char *path, int type)
 {
     int ret = 0;
@@ -255,6 +687,14 @@ static void astream_usage()
         "    -i|--inotify_directory <dir path>   one or more monitored directories\n"
         "    -r|--rule_file <file path>          one or more rule files\n"
         "    -l|--log_level <log level>          set the global log level\n"
+        "    -w|--wa_source <type:arg>           tune the streams by WA samples from\n"
+        "                                        nvme:<device> or replay:<file>\n"
+        "    -e|--tune_epoch <seconds>           the length of each tuning epoch\n"
+        "    -q|--queue_limit <events>           the max events each device handles\n"
+        "                                        in one wakeup, the others wait in\n"
+        "                                        the kernel queue\n"
+        "    -a|--affinity                       pin the worker of each device to the\n"
+        "                                        cpus of its numa node\n"
         "    -h|--help                           show the usage of astream\n"
         "    stop                                stop the astream stop normally\n");
 }
@@ -300,6 +740,16 @@ static int check_cmdline(int opt, int argc, char **argv, int *monitored_dirs_arr
                 ++optind;
             }
             break;
+        case 'q':
+            queue_limit = atoi(optarg);
+            if (queue_limit <= 0) {
+                printf("error: invalid queue limit %s\n", optarg);
+                ret = -1;
+            }
+            break;
+        case 'a':
+            worker_affinity = 1;
+            break;
         case 'h':
             astream_usage();
             break;
@@ -314,6 +764,16 @@ static int check_cmdline(int opt, int argc, char **argv, int *monitored_dirs_arr
             if (ret != -1)
                 set_global_astream_log_level(ret);
             break;
+        case 'w':
+            tune_source = optarg;
+            break;
+        case 'e':
+            tune_epoch = atoi(optarg);
+            if (tune_epoch <= 0) {
+                printf("error: invalid tune epoch %s\n", optarg);
+                ret = -1;
+            }
+            break;
         case '?':
         default:
             ret = -1;
@@ -325,29 +785,31 @@ err:
     return ret;
 }
 
-static int check_parse_result(int argc, int nr_arguments, const int *help, int log_level)
+static int check_parse_result(int argc, int nr_arguments, const int *help,
+                              int nr_monitored_dirs)
 {
-    if (*help && nr_arguments == argc - 1) /* for astream -h */
-        return 0;
+    if (nr_arguments != argc - 1) {
+        printf("warning: useless parameters passed in\n");
+        return -1;
+    }
 
-    /* for astream -i xx -r xx [-l 1] */
-    if (!(*help) && nr_arguments >= 4 && nr_arguments == argc - 1)
+    if (*help) /* for astream -h */
         return 0;
 
-    if (log_level && nr_arguments == argc - 1) {
+    /* for astream -i xx -r xx [-l 1], the other options need a target too. */
+    if (nr_monitored_dirs == 0) {
         printf("warning: -r and -i options are required\n");
         return -1;
     }
 
-    printf("warning: useless parameters passed in\n");
-    return -1;
+    return 0;
 }
 
 static int parse_cmdline(int argc, char **argv, int *help)
 {
-    const char *opt_str = "i:r:l:h";
+    const char *opt_str = "i:r:l:w:e:q:ah";
     int ret = 0;
-    int log_level = 0;
+    int epoch_set = 0;
     int opt, nr_targets = 0;
     int nr_arguments = 0, nr_monitored_dirs = 0, nr_rule_files = 0;
     /*
@@ -364,6 +826,10 @@ static int parse_cmdline(int argc, char **argv, int *help)
         {"rule_file", required_argument, NULL, 'r'},
         {"help", no_argument, NULL, 'h'},
         {"log_level", required_argument, NULL, 'l'},
+        {"wa_source", required_argument, NULL, 'w'},
+        {"tune_epoch", required_argument, NULL, 'e'},
+        {"queue_limit", required_argument, NULL, 'q'},
+        {"affinity", no_argument, NULL, 'a'},
         {NULL, 0, NULL, 0},
     };
 
@@ -384,8 +850,12 @@ static int parse_cmdline(int argc, char **argv, int *help)
         }
 
         ++nr_arguments;
+        if (opt == 'e')
+            epoch_set = 1;
+
         if (opt == 'l') {
-            log_level = 1;
+            ++nr_arguments;
+        } else if (opt == 'w' || opt == 'e' || opt == 'q') {
             ++nr_arguments;
         }
     }
@@ -393,12 +863,19 @@ static int parse_cmdline(int argc, char **argv, int *help)
     nr_arguments += nr_monitored_dirs;
     nr_arguments += nr_rule_files;
 
-    ret = check_parse_result(argc, nr_arguments, help, log_level);
+    ret = check_parse_result(argc, nr_arguments, help, nr_monitored_dirs);
     if (ret < 0) {
         astream_usage();
         goto err;
     }
 
+    if (epoch_set && !tune_source) {
+        ret = -1;
+        printf("error: -e option only works with -w option\n");
+        astream_usage();
+        goto err;
+    }
+
     if (nr_monitored_dirs != nr_rule_files) {
         ret = -1;
         printf("error: please input one pair of monitored directory and its "
@@ -409,7 +886,9 @@ static int parse_cmdline(int argc, char **argv, int *help)
         /* start to parse all the stream rules inside rule files */
         while (nr_targets < nr_monitored_dirs) {
             watch_target_t target;
-            realpath(argv[monitored_dirs_arr[nr_targets]], target.watch_dir);
+            if (resolve_path(argv[monitored_dirs_arr[nr_targets]], target.watch_dir) < 0 ||
+                resolve_path(argv[rule_files_arr[nr_targets]], target.rule_file) < 0)
+                return -1;
             target.rule_num = parse_stream_rule(argv[rule_files_arr[nr_targets]], &target);
             if (target.rule_num == -1)
                 return -1;
@@ -425,40 +904,84 @@ err:
     return ret;
 }
 
-static void start_inotify(int argc)
+static void stop_inotify(void)
 {
-    /* init inotify instance. */
-    inotify_fd = inotify_init();
-    if (inotify_fd < 0) {
-        astream_log(ASTREAM_LOG_ERROR, "inotify_init() failed\n");
-        return;
+    for (int i = 0; i < nr_timers; ++i)
+        close(timers[i].fd);
+    nr_timers = 0;
+
+    if (signal_fd >= 0)
+        close(signal_fd);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    signal_fd = epoll_fd = -1;
+
+    /* the workers may still report a failure until they are joined. */
+    stop_groups();
+    if (fail_fd >= 0)
+        close(fail_fd);
+    fail_fd = -1;
+
+    tuner_exit();
+}
+
+static int start_inotify(int argc)
+{
+    sigset_t mask;
+    int ret;
+
+    /* the stop signals are handled by the main loop through a signalfd,
+     * they are blocked before any worker starts so that workers inherit it. */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        astream_log(ASTREAM_LOG_ERROR, "sigprocmask() failed\n");
+        return -1;
     }
 
-    /* add all monitored directories one by one. */
-    for (int i = 1; i <= nr_watches; ++i) {
-        add_watch(inotify_fd, i);
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        astream_log(ASTREAM_LOG_ERROR, "signalfd() failed\n");
+        goto err;
     }
 
-    astream_log(ASTREAM_LOG_INFO, "the astream is started successful, and "
-                "begin to monitor\n");
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        astream_log(ASTREAM_LOG_ERROR, "epoll_create1() failed\n");
+        goto err;
+    }
 
-    /* receive notification and handle it. */
-    inotify_accept(inotify_fd);
-}
+    fail_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fail_fd < 0) {
+        astream_log(ASTREAM_LOG_ERROR, "eventfd() failed\n");
+        goto err;
+    }
 
-static void signalHandler(int signum)
-{
-    /* stop the astream daemon and release some sources when we get a signal. */
-    if (fp != NULL) {
-        fclose(fp);
-        flock(fp->_fileno, LOCK_UN);
+    if (add_to_epoll(epoll_fd, signal_fd) < 0 || add_to_epoll(epoll_fd, fail_fd) < 0) {
+        astream_log(ASTREAM_LOG_ERROR, "epoll_ctl() failed\n");
+        goto err;
     }
 
-    if (inotify_fd == 0)
-        free_res(inotify_fd);
+    /* add all monitored directories, grouped by their backing devices. */
+    if (init_groups() < 0)
+        goto err;
 
-    astream_log(ASTREAM_LOG_INFO, "the astream daemon has been stopped\n");
-    exit(EXIT_SUCCESS);
+    if (tuner_enabled() && add_timer("tuner", tune_epoch, tuner_run_epoch) < 0)
+        goto err;
+
+    astream_log(ASTREAM_LOG_INFO, "the astream is started successful, and "
+                "begin to monitor\n");
+
+    /* receive notification and handle it. */
+    ret = event_loop();
+    stop_inotify();
+
+    return ret;
+err:
+    stop_inotify();
+    return -1;
 }
 
 static void astream_stop() {
@@ -522,6 +1045,7 @@ int main(int argc, char **argv)
          goto err;
     }
 
+    astream_log_init();
     set_global_astream_log_level(ASTREAM_LOG_INFO);
 
     /* verify the permission of the user */
@@ -536,6 +1060,10 @@ int main(int argc, char **argv)
         goto err;
     }
 
+    /* the tuner is optional, and only enabled by a WA source. */
+    if (tune_source && tuner_init(tune_source, tune_epoch, targets, nr_watches) < 0)
+        goto err;
+
     /* start this process with daemon. 
      * the first argument denote the daemon uses the current directory as its working 
      * directory，but not the root; the second argument means redirect all 
@@ -551,12 +1079,17 @@ int main(int argc, char **argv)
     len = snprintf(buf, MAX_PID_BUFFER_SIZE, "%d\n", (int)getpid());
     write(fp->_fileno, buf, len);
 
-    signal(SIGUSR1, signalHandler);
+    /* start to watch the directories until the daemon is asked to stop. */
+    ret = start_inotify(argc);
 
-    /* start to watch the directories. */
-    start_inotify(argc);
+    flock(fp->_fileno, LOCK_UN);
+    fclose(fp);
+    if (ret < 0)
+        astream_log(ASTREAM_LOG_ERROR, "the astream daemon exits on error\n");
+    else
+        astream_log(ASTREAM_LOG_INFO, "the astream daemon has been stopped\n");
 
-    return 0;
+    return ret;
 err:
     if(fp)
         fclose(fp);
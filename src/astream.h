@@ -14,15 +14,23 @@
 #define __ASTREAM_H__
 
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <unistd.h>
 
 #define BUFF_SIZE 1024
 #define MAX_PID_BUFFER_SIZE 32
 #define MAX_STREAM_RULE_NUM 256
+#define MAX_EPOLL_EVENTS 16
+#define MAX_TIMER_NUM 8
+#define MAX_GROUP_NUM 64
+#define MAX_GROUP_WATCHES (BUFF_SIZE + 1)
 
 #define EVENT_SIZE sizeof(struct inotify_event)
 #define EVENT_BUF_LEN (1024 * (EVENT_SIZE + 16))
+#define EVENT_MAX_SIZE (EVENT_SIZE + NAME_MAX + 1)
 
 #define FILE_TYPE 1
 #define DIR_TYPE 2
@@ -37,6 +45,8 @@
 
 typedef struct watch_target watch_target_t;
 typedef struct stream_rule stream_rule_t;
+typedef struct loop_timer loop_timer_t;
+typedef struct target_group target_group_t;
 
 struct stream_rule {
     char rule[BUFF_SIZE];
@@ -48,7 +58,38 @@ struct stream_rule {
  */
 struct watch_target {
     char watch_dir[BUFF_SIZE];
+    char rule_file[BUFF_SIZE];
     stream_rule_t stream_rule[MAX_STREAM_RULE_NUM];
     int rule_num;
 };
+
+/*
+ * a periodic job of the main loop, driven by its own timerfd.
+ */
+struct loop_timer {
+    const char *name;
+    int interval; /* seconds */
+    void (*fn)(void);
+    int fd;
+};
+
+/*
+ * the targets on the same backing device share one inotify instance and one
+ * worker thread, which is optionally pinned to the numa node of the device.
+ */
+struct target_group {
+    dev_t dev;
+    int inotify_fd;
+    int stop_fd; /* eventfd to stop the worker */
+    int epoll_fd;
+    int wd_target[MAX_GROUP_WATCHES]; /* index of targets[] for each wd */
+    int nr_targets;
+    int numa_node;
+    cpu_set_t cpus;
+    int nr_cpus;
+    pthread_t worker;
+    int started;
+};
+
+void do_set_stream(int stream, const char *target_file);
 #endif
\ No newline at end of file
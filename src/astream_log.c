@@ -39,38 +39,51 @@ int set_global_astream_log_level(enum log_level level)
     return 0;
 }
 
+/*
+ * open the syslog once at start, the level tag goes into each message, so
+ * the workers never touch the ident shared by the process.
+ */
+void astream_log_init(void)
+{
+    openlog("astream", LOG_CONS, LOG_USER);
+}
+
 void astream_log(enum log_level level, const char *format, ...)
 {
+    char tagged[LOG_FORMAT_SIZE];
+    const char *tag;
+    int priority;
     va_list args;
 
     if (level < g_log_level)
         return;
 
-    va_start(args, format);
     switch (level) {
         case ASTREAM_LOG_DEBUG:
-            openlog("[astream_debug]", LOG_CONS, LOG_USER);
-            vsyslog(LOG_INFO, format, args);
+            tag = "[astream_debug] ";
+            priority = LOG_INFO;
             break;
         case ASTREAM_LOG_INFO:
-            openlog("[astream_info] ", LOG_CONS, LOG_USER);
-            vsyslog(LOG_INFO, format, args);
+            tag = "[astream_info] ";
+            priority = LOG_INFO;
             break;
         case ASTREAM_LOG_WARN:
-            openlog("[astream_warn] ", LOG_CONS, LOG_USER);
-            vsyslog(LOG_WARNING, format, args);
+            tag = "[astream_warn] ";
+            priority = LOG_WARNING;
             break;
         case ASTREAM_LOG_ERROR:
-            openlog("[astream_error] ", LOG_CONS, LOG_USER);
-            vsyslog(LOG_ERR, format, args);
+            tag = "[astream_error] ";
+            priority = LOG_ERR;
             break;
         default:
-            openlog("[astream_error] ", LOG_CONS, LOG_USER);
-            vsyslog(LOG_ERR, "invalid log level\n", args);
+            syslog(LOG_ERR, "[astream_error] invalid log level\n");
+            return;
     }
 
+    snprintf(tagged, LOG_FORMAT_SIZE, "%s%s", tag, format);
+    va_start(args, format);
+    vsyslog(priority, tagged, args);
     va_end(args);
-    closelog();
-    
+
     return;
-}
\ No newline at end of file
+}
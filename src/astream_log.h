@@ -13,6 +13,8 @@
 #ifndef __ASTREAM_LOG_H__
 #define __ASTREAM_LOG_H__
 
+#define LOG_FORMAT_SIZE 512 /* a format string with its level tag */
+
 enum log_level {
     ASTREAM_LOG_DEBUG = 1,
     ASTREAM_LOG_INFO,
@@ -23,5 +25,6 @@ enum log_level {
 void log_level_usage(void);
 int set_global_astream_log_level(enum log_level level);
 
+void astream_log_init(void);
 void astream_log(enum log_level level, const char *format, ...);
 #endif
\ No newline at end of file
@@ -0,0 +1,602 @@
+/*
+* Copyright (c) 2021-2022 Huawei Technologies Co., Ltd.
+* astream is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*     http://license.coscl.org.cn/MulanPSL2
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+* See the Mulan PSL v2 for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/nvme_ioctl.h>
+#include "astream.h"
+#include "astream_log.h"
+#include "astream_tuner.h"
+
+/*
+ * a rule class is one stream rule of one target, the tuner moves classes
+ * between hint values, moving a class onto a hint already used by other
+ * classes groups them together.
+ */
+struct tune_class {
+    stream_rule_t *rule;
+    const char *watch_dir;
+    const char *rule_file;
+    int best_stream;
+    char *files[TUNE_MAX_TRACKED_FILES];
+    unsigned long long blocks[TUNE_MAX_TRACKED_FILES];
+    int nr_files;
+    int next_file;
+    unsigned long long alloc_bytes; /* allocation growth of the tracked files */
+};
+
+static struct tune_class *classes = NULL;
+static int *order = NULL; /* class indices sorted by allocation growth */
+static int nr_classes = 0;
+static wa_source_t *wa_src = NULL;
+static FILE *journal = NULL;
+static unsigned long nr_epochs = 0;
+static double best_wa = -1;
+static int round_pos = -1; /* position in order[] of the current round */
+static int trial_class = -1; /* the class on trial in the current epoch */
+static int trial_hint = 0;
+static int trial_old = 0;
+static int round_improved = 0;
+static int rebaseline = 0; /* measure the best grouping again before the next trial */
+static int stopped = 0;
+/* the workers track files while the main loop runs the epochs. */
+static pthread_mutex_t tuner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int nvme_open(wa_source_t *src, const char *arg);
+static int nvme_sample(wa_source_t *src, double *wa);
+static void nvme_close(wa_source_t *src);
+static int replay_open(wa_source_t *src, const char *arg);
+static int replay_sample(wa_source_t *src, double *wa);
+static void replay_close(wa_source_t *src);
+
+static wa_source_t wa_sources[] = {
+    {"nvme", nvme_open, nvme_sample, nvme_close, -1, NULL, 0, 0},
+    {"replay", replay_open, replay_sample, replay_close, -1, NULL, 0, 0},
+};
+
+static unsigned long long get_le64(const unsigned char *p)
+{
+    unsigned long long val = 0;
+
+    for (int i = 7; i >= 0; --i)
+        val = (val << 8) | p[i];
+
+    return val;
+}
+
+/* read the cumulative host and gc write counters, in units of 4K. */
+static int nvme_read_counters(int fd, unsigned long long *host, unsigned long long *gc)
+{
+    unsigned char log[NVME_WA_LOG_LEN];
+    struct nvme_admin_cmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = 0x02; /* get log page */
+    cmd.nsid = 0xffffffff;
+    cmd.addr = (unsigned long)log;
+    cmd.data_len = NVME_WA_LOG_LEN;
+    cmd.cdw10 = NVME_WA_LOG_PAGE | (((NVME_WA_LOG_LEN >> 2) - 1) << 16);
+
+    if (ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd) < 0)
+        return -errno;
+
+    *host = get_le64(log + NVME_WA_HOST_OFFSET);
+    *gc = get_le64(log + NVME_WA_GC_OFFSET);
+
+    return 0;
+}
+
+static int nvme_open(wa_source_t *src, const char *arg)
+{
+    src->fd = open(arg, O_RDONLY);
+    if (src->fd < 0)
+        return -errno;
+
+    return nvme_read_counters(src->fd, &src->last_host, &src->last_gc);
+}
+
+static int nvme_sample(wa_source_t *src, double *wa)
+{
+    unsigned long long host, gc;
+    int ret;
+
+    ret = nvme_read_counters(src->fd, &host, &gc);
+    if (ret < 0)
+        return ret;
+
+    /* no host writes during the epoch, the WA is meaningless. */
+    if (host <= src->last_host) {
+        src->last_gc = gc;
+        return -EAGAIN;
+    }
+
+    *wa = (double)(host - src->last_host + gc - src->last_gc) /
+          (double)(host - src->last_host);
+    src->last_host = host;
+    src->last_gc = gc;
+
+    return 0;
+}
+
+static void nvme_close(wa_source_t *src)
+{
+    if (src->fd >= 0)
+        close(src->fd);
+    src->fd = -1;
+}
+
+static int replay_open(wa_source_t *src, const char *arg)
+{
+    src->fp = fopen(arg, "r");
+    if (!src->fp)
+        return -errno;
+
+    return 0;
+}
+
+/*
+ * each line is either a single WA value or the "nandMB hostMB WA" line
+ * appended to result_WA.txt by calculate_wa.sh. calculate_wa.sh leaves the
+ * WA empty when there are no host writes, such lines and any WA which is not
+ * a finite positive value are skipped.
+ */
+static int replay_sample(wa_source_t *src, double *wa)
+{
+    char line[BUFF_SIZE];
+    char *token, *save = NULL;
+    char *tokens[3];
+    char *end;
+    int nr_tokens;
+
+    while (fgets(line, BUFF_SIZE, src->fp) != NULL) {
+        nr_tokens = 0;
+        for (token = strtok_r(line, " \t\n", &save); token;
+             token = strtok_r(NULL, " \t\n", &save)) {
+            if (nr_tokens < 3)
+                tokens[nr_tokens] = token;
+            ++nr_tokens;
+        }
+
+        if (nr_tokens != 1 && nr_tokens != 3)
+            continue;
+
+        *wa = strtod(tokens[nr_tokens - 1], &end);
+        if (*end != '\0' || !isfinite(*wa) || *wa <= 0) {
+            astream_log(ASTREAM_LOG_WARN, "tuner: skip the invalid wa sample %s\n",
+                        tokens[nr_tokens - 1]);
+            continue;
+        }
+
+        return 0;
+    }
+
+    return -ENODATA;
+}
+
+static void replay_close(wa_source_t *src)
+{
+    if (src->fp)
+        fclose(src->fp);
+    src->fp = NULL;
+}
+
+static void journal_log(const char *format, ...)
+{
+    char buf[BUFF_SIZE];
+    char stamp[MAX_PID_BUFFER_SIZE];
+    time_t now = time(NULL);
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(buf, BUFF_SIZE, format, args);
+    va_end(args);
+
+    astream_log(ASTREAM_LOG_INFO, "tuner: %s\n", buf);
+
+    if (!journal)
+        return;
+
+    strftime(stamp, MAX_PID_BUFFER_SIZE, "%F %T", localtime(&now));
+    fprintf(journal, "%s epoch %lu %s\n", stamp, nr_epochs, buf);
+    fflush(journal);
+}
+
+/*
+ * move a class to a hint value. only the tracked files are re-hinted, the
+ * files created before the start or evicted from the tracking ring keep the
+ * hint they were created with, so a grouping is only partly applied to them.
+ */
+static void apply_hint(struct tune_class *class, int stream)
+{
+    class->rule->stream = stream;
+    for (int i = 0; i < class->nr_files; ++i)
+        do_set_stream(stream, class->files[i]);
+}
+
+/*
+ * sample the allocation growth of the tracked files of each class. this is
+ * not the write volume: files overwritten in place or preallocated, such as
+ * the InnoDB redo and undo logs, do not grow and are counted as zero.
+ */
+static void sample_alloc_growth(void)
+{
+    struct stat st;
+
+    for (int i = 0; i < nr_classes; ++i) {
+        struct tune_class *class = &classes[i];
+
+        for (int j = 0; j < class->nr_files;) {
+            if (stat(class->files[j], &st) < 0) {
+                /* the file has gone, drop it from the class. */
+                free(class->files[j]);
+                --class->nr_files;
+                class->files[j] = class->files[class->nr_files];
+                class->blocks[j] = class->blocks[class->nr_files];
+                class->next_file = class->nr_files;
+                continue;
+            }
+
+            if ((unsigned long long)st.st_blocks > class->blocks[j])
+                class->alloc_bytes += (st.st_blocks - class->blocks[j]) * 512ULL;
+            class->blocks[j] = st.st_blocks;
+            ++j;
+        }
+    }
+}
+
+static int cmp_alloc_growth(const void *a, const void *b)
+{
+    unsigned long long va = classes[*(const int *)a].alloc_bytes;
+    unsigned long long vb = classes[*(const int *)b].alloc_bytes;
+
+    return (va < vb) - (va > vb);
+}
+
+/*
+ * pick the next grouping to try: in each round the classes are visited from
+ * the largest allocation growth to the smallest, which is only a heuristic
+ * order, and each one is tried on every other hint value. a round without any improvement means the tuner has converged.
+ */
+static int next_trial(void)
+{
+    while (1) {
+        if (round_pos < 0 || round_pos >= nr_classes) {
+            if (round_pos >= nr_classes && !round_improved)
+                return -1;
+
+            qsort(order, nr_classes, sizeof(int), cmp_alloc_growth);
+            round_pos = 0;
+            round_improved = 0;
+            trial_hint = TUNE_MIN_HINT - 1;
+        }
+
+        struct tune_class *class = &classes[order[round_pos]];
+
+        while (++trial_hint <= TUNE_MAX_HINT) {
+            if (trial_hint != class->best_stream)
+                return order[round_pos];
+        }
+
+        ++round_pos;
+        trial_hint = TUNE_MIN_HINT - 1;
+    }
+}
+
+/*
+ * write the best grouping of each target next to its rule file, the input
+ * rule file is never touched, so restarting with it reverts the tuning.
+ */
+static void dump_tuned_rules(void)
+{
+    char path[BUFF_SIZE + MAX_PID_BUFFER_SIZE];
+    char tmp[BUFF_SIZE + 2 * MAX_PID_BUFFER_SIZE];
+    FILE *out = NULL;
+
+    for (int i = 0; i < nr_classes; ++i) {
+        /* the classes of one target are next to each other. */
+        if (i == 0 || classes[i].rule_file != classes[i - 1].rule_file) {
+            snprintf(path, sizeof(path), "%s%s", classes[i].rule_file, TUNE_RULE_SUFFIX);
+            snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+            out = fopen(tmp, "w");
+            if (!out)
+                journal_log("failed to open %s", tmp);
+        }
+
+        if (out)
+            fprintf(out, "%s %d\n", classes[i].rule->rule, classes[i].best_stream);
+
+        if (out && (i == nr_classes - 1 || classes[i].rule_file != classes[i + 1].rule_file)) {
+            if (fclose(out) != 0 || rename(tmp, path) < 0)
+                journal_log("failed to write %s", path);
+            else
+                journal_log("dump the best grouping to %s", path);
+            out = NULL;
+        }
+    }
+}
+
+static void stop_tuning(const char *reason)
+{
+    stopped = 1;
+    journal_log("stop: %s, keep the grouping with wa %.5f", reason, best_wa);
+    dump_tuned_rules();
+}
+
+static void run_epoch(void)
+{
+    struct tune_class *class;
+    double wa;
+    int ret;
+
+    if (!wa_src || stopped)
+        return;
+
+    sample_alloc_growth();
+
+    ret = wa_src->sample(wa_src, &wa);
+    if (ret == -EAGAIN) {
+        astream_log(ASTREAM_LOG_INFO, "tuner: no host writes in this epoch, "
+                    "extend it\n");
+        return;
+    }
+
+    if (ret < 0) {
+        if (trial_class >= 0) {
+            class = &classes[trial_class];
+            apply_hint(class, trial_old);
+            journal_log("revert %s %s %d->%d", class->watch_dir,
+                        class->rule->rule, trial_hint, trial_old);
+            trial_class = -1;
+        }
+        stop_tuning(ret == -ENODATA ? "wa source exhausted" : "failed to sample wa");
+        return;
+    }
+
+    ++nr_epochs;
+    if (best_wa < 0) {
+        best_wa = wa;
+        journal_log("baseline wa %.5f", wa);
+    } else if (rebaseline) {
+        journal_log("rebaseline wa %.5f, was %.5f", wa, best_wa);
+        best_wa = wa;
+        rebaseline = 0;
+    } else if (trial_class >= 0) {
+        class = &classes[trial_class];
+        if (wa < best_wa * (1 - TUNE_MIN_GAIN)) {
+            journal_log("accept %s %s %d->%d wa %.5f best %.5f", class->watch_dir,
+                        class->rule->rule, trial_old, trial_hint, wa, best_wa);
+            class->best_stream = trial_hint;
+            best_wa = wa;
+            round_improved = 1;
+        } else {
+            apply_hint(class, trial_old);
+            journal_log("revert %s %s %d->%d wa %.5f best %.5f", class->watch_dir,
+                        class->rule->rule, trial_hint, trial_old, wa, best_wa);
+            /*
+             * the gc caused by the rejected grouping and any drift of the
+             * workload would bias the next trial, so measure the best
+             * grouping for a whole epoch before trying the next one.
+             */
+            rebaseline = 1;
+        }
+        trial_class = -1;
+        if (rebaseline)
+            return;
+    }
+
+    trial_class = next_trial();
+    if (trial_class < 0) {
+        stop_tuning("converged");
+        return;
+    }
+
+    class = &classes[trial_class];
+    trial_old = class->best_stream;
+    apply_hint(class, trial_hint);
+    journal_log("try %s %s %d->%d", class->watch_dir, class->rule->rule,
+                trial_old, trial_hint);
+}
+
+void tuner_run_epoch(void)
+{
+    pthread_mutex_lock(&tuner_lock);
+    run_epoch();
+    pthread_mutex_unlock(&tuner_lock);
+}
+
+static void track_file(const stream_rule_t *rule, const char *path)
+{
+    struct tune_class *class = NULL;
+    struct stat st;
+    char *path_copy;
+
+    for (int i = 0; i < nr_classes; ++i) {
+        if (classes[i].rule == rule) {
+            class = &classes[i];
+            break;
+        }
+    }
+
+    if (!class)
+        return;
+
+    path_copy = strdup(path);
+    if (!path_copy)
+        return;
+
+    /* keep the latest created files only, replacing the oldest one. */
+    if (class->nr_files < TUNE_MAX_TRACKED_FILES) {
+        class->next_file = class->nr_files++;
+    } else {
+        class->next_file = (class->next_file + 1) % TUNE_MAX_TRACKED_FILES;
+        free(class->files[class->next_file]);
+    }
+
+    class->files[class->next_file] = path_copy;
+    class->blocks[class->next_file] = stat(path, &st) == 0 ? st.st_blocks : 0;
+}
+
+/*
+ * set the stream of a created file from its rule and return it. the rule may
+ * be moved by the main loop meanwhile, so the stream is read, and the re-hint
+ * and tracking are decided, under the lock.
+ */
+int tuner_hint_file(const stream_rule_t *rule, const char *path)
+{
+    int stream;
+
+    /* without a wa source, the streams never change after start. */
+    if (!wa_src) {
+        do_set_stream(rule->stream, path);
+        return rule->stream;
+    }
+
+    pthread_mutex_lock(&tuner_lock);
+    stream = rule->stream;
+    pthread_mutex_unlock(&tuner_lock);
+
+    do_set_stream(stream, path);
+
+    pthread_mutex_lock(&tuner_lock);
+    /* the class has been moved, or reverted at stop, since the file was hinted. */
+    if (rule->stream != stream) {
+        stream = rule->stream;
+        do_set_stream(stream, path);
+    }
+
+    if (!stopped)
+        track_file(rule, path);
+    pthread_mutex_unlock(&tuner_lock);
+
+    return stream;
+}
+
+int tuner_enabled(void)
+{
+    int enabled;
+
+    pthread_mutex_lock(&tuner_lock);
+    enabled = wa_src != NULL && !stopped;
+    pthread_mutex_unlock(&tuner_lock);
+
+    return enabled;
+}
+
+/*
+ * init the tuner with a WA source given as <type>:<arg>, e.g.
+ * nvme:/dev/nvme0 or replay:/root/result_WA.txt.
+ */
+int tuner_init(const char *source, int epoch, watch_target_t *targets, int nr_targets)
+{
+    const char *arg = strchr(source, ':');
+    int ret;
+
+    for (int i = 0; arg && i < sizeof(wa_sources) / sizeof(wa_sources[0]); ++i) {
+        if (strncmp(source, wa_sources[i].name, arg - source) == 0 &&
+            strlen(wa_sources[i].name) == arg - source) {
+            wa_src = &wa_sources[i];
+            break;
+        }
+    }
+
+    if (!wa_src) {
+        printf("error: invalid wa source %s\n", source);
+        return -EINVAL;
+    }
+
+    for (int i = 1; i <= nr_targets; ++i)
+        nr_classes += targets[i].rule_num;
+
+    if (nr_classes == 0) {
+        printf("error: no stream rule to tune\n");
+        ret = -EINVAL;
+        goto err;
+    }
+
+    classes = calloc(nr_classes, sizeof(struct tune_class));
+    order = calloc(nr_classes, sizeof(int));
+    if (!classes || !order) {
+        printf("error: failed to alloc memory for the tuner\n");
+        ret = -ENOMEM;
+        goto err;
+    }
+
+    for (int i = 1, n = 0; i <= nr_targets; ++i) {
+        for (int j = 0; j < targets[i].rule_num; ++j, ++n) {
+            classes[n].rule = &targets[i].stream_rule[j];
+            classes[n].watch_dir = targets[i].watch_dir;
+            classes[n].rule_file = targets[i].rule_file;
+            classes[n].best_stream = targets[i].stream_rule[j].stream;
+            order[n] = n;
+        }
+    }
+
+    ret = wa_src->open(wa_src, arg + 1);
+    if (ret < 0) {
+        printf("error: failed to open wa source %s: %s\n", source, strerror(-ret));
+        goto err;
+    }
+
+    journal = fopen(TUNE_JOURNAL_FILE, "a");
+    if (!journal)
+        printf("warning: failed to open %s, decisions go to syslog only\n",
+               TUNE_JOURNAL_FILE);
+
+    journal_log("start with wa source %s, epoch %d seconds", source, epoch);
+    for (int i = 0; i < nr_classes; ++i)
+        journal_log("class %s %s %d", classes[i].watch_dir, classes[i].rule->rule,
+                    classes[i].best_stream);
+
+    return 0;
+
+err:
+    tuner_exit();
+    return ret;
+}
+
+void tuner_exit(void)
+{
+    /* keep the best grouping found so far when the daemon stops. */
+    if (wa_src && !stopped && best_wa >= 0) {
+        if (trial_class >= 0)
+            apply_hint(&classes[trial_class], trial_old);
+        trial_class = -1;
+        stop_tuning("daemon stopped");
+    }
+
+    for (int i = 0; classes && i < nr_classes; ++i) {
+        for (int j = 0; j < classes[i].nr_files; ++j)
+            free(classes[i].files[j]);
+    }
+
+    free(classes);
+    free(order);
+    classes = NULL;
+    order = NULL;
+    nr_classes = 0;
+
+    if (wa_src)
+        wa_src->close(wa_src);
+    wa_src = NULL;
+
+    if (journal)
+        fclose(journal);
+    journal = NULL;
+}
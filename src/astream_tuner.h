@@ -0,0 +1,55 @@
+/*
+* Copyright (c) 2021-2022 Huawei Technologies Co., Ltd.
+* astream is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*     http://license.coscl.org.cn/MulanPSL2
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+* See the Mulan PSL v2 for more details.
+*/
+
+#ifndef __ASTREAM_TUNER_H__
+#define __ASTREAM_TUNER_H__
+
+#include <stdio.h>
+#include "astream.h"
+
+#define TUNE_JOURNAL_FILE "/var/log/astream_tune.log"
+#define TUNE_RULE_SUFFIX ".tuned" /* the best grouping is dumped to <rule_file>.tuned */
+#define TUNE_DEFAULT_EPOCH 3600 /* seconds */
+#define TUNE_MIN_HINT 1 /* RWH_WRITE_LIFE_NONE */
+#define TUNE_MAX_HINT 5 /* RWH_WRITE_LIFE_EXTREME */
+#define TUNE_MIN_GAIN 0.01 /* relative WA drop required to keep a grouping */
+#define TUNE_MAX_TRACKED_FILES 64
+
+/* vendor log page holding the host and gc write counters, see calculate_wa.sh */
+#define NVME_WA_LOG_PAGE 0xc0
+#define NVME_WA_LOG_LEN 800
+#define NVME_WA_HOST_OFFSET 0x1c4
+#define NVME_WA_GC_OFFSET 0x1d0
+
+typedef struct wa_source wa_source_t;
+
+/*
+ * a source of write-amplification samples, each sample returns the WA
+ * measured since the previous one.
+ */
+struct wa_source {
+    const char *name;
+    int (*open)(wa_source_t *src, const char *arg);
+    int (*sample)(wa_source_t *src, double *wa);
+    void (*close)(wa_source_t *src);
+    int fd;
+    FILE *fp;
+    unsigned long long last_host;
+    unsigned long long last_gc;
+};
+
+int tuner_init(const char *source, int epoch, watch_target_t *targets, int nr_targets);
+int tuner_enabled(void);
+void tuner_run_epoch(void);
+int tuner_hint_file(const stream_rule_t *rule, const char *path);
+void tuner_exit(void);
+#endif
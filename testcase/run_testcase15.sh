@@ -0,0 +1,2 @@
+# a testcase for tuning the streams of a mysql process with the replayed WA samples #
+astream -i /data/mysql-1/data -r rule1.txt -w replay:wa_replay.txt -e 60
@@ -0,0 +1,3 @@
+# a testcase for two mysql processes whose data directories are mounted on two NVMe devices, #
+# each device gets its own worker pinned to its numa node, handling at most 1024 events per wakeup #
+astream -i /data/mysql-1/data /data/mysql-2/data -r rule1.txt rule2.txt -a -q 1024